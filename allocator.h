@@ -4,6 +4,15 @@
 #include <cassert>
 #include <new>
 #include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 template<class T, std::size_t N> class TestAllocatorAccessor;
 
@@ -13,14 +22,639 @@ namespace allocator
 const char DEALLOCATE_STATE = 0;
 const char ALLOCATE_STATE = 1;
 
-template<class T, std::size_t N, bool Expand = false>
+namespace detail
+{
+
+inline unsigned countTrailingZeros(std::uint64_t v) noexcept
+{
+    assert(v);
+#if defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_ctzll(v) );
+#else
+    unsigned n = 0;
+    for(; !(v & 1); v >>= 1)
+        ++n;
+    return n;
+#endif
+}
+
+inline unsigned countLeadingZeros(std::uint64_t v) noexcept
+{
+    assert(v);
+#if defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_clzll(v) );
+#else
+    unsigned n = 0;
+    for(; !(v & (std::uint64_t(1) << 63) ); v <<= 1)
+        ++n;
+    return n;
+#endif
+}
+
+inline unsigned popCount(std::uint64_t v) noexcept
+{
+#if defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_popcountll(v) );
+#else
+    unsigned n = 0;
+    for(; v; v &= v - 1)
+        ++n;
+    return n;
+#endif
+}
+
+//Маска из n единичных бит, начиная с бита first (first + n <= 64)
+inline std::uint64_t rangeMask(std::size_t first, std::size_t n) noexcept
+{
+    return (n >= 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << n) - 1) << first;
+}
+
+//Биты, с которых начинается серия из n единиц маски free (1 <= n <= 64).
+//Серия ищется удвоением за O(log n) операций без ветвлений по данным
+inline std::uint64_t runStarts(std::uint64_t free, std::size_t n) noexcept
+{
+    std::size_t len = 1;
+    while(len * 2 <= n)
+    {
+        free &= free >> len;
+        len *= 2;
+    }
+    if(len < n)
+        free &= free >> (n - len);
+    return free;
+}
+
+//Наименьшее беззнаковое слово, вмещающее Bits флагов
+template<std::size_t Bits>
+using SlotWord = typename std::conditional<(Bits <= 8), std::uint8_t,
+                 typename std::conditional<(Bits <= 16), std::uint16_t,
+                 typename std::conditional<(Bits <= 32), std::uint32_t, std::uint64_t>::type>::type>::type;
+
+//Карта занятости N ячеек блока (бит установлен - ячейка используется).
+//При N <= 64 карта - одно слово минимального размера,
+//при большем N - слова по 64 бита и вложенная карта заполненных слов,
+//так что поиск свободной ячейки занимает O(log N)
+template<std::size_t N, bool Flat = (N <= 64)>
+class SlotMap
+{
+    using word_type = SlotWord<N>;
+public:
+    bool test(std::size_t i) const noexcept
+    {
+        return (m_bits >> i) & 1;
+    }
+
+    //Начало первой серии из n свободных ячеек, либо N, если такой нет
+    std::size_t findFree(std::size_t n) const noexcept
+    {
+        if(n > N)
+            return N;
+        std::uint64_t starts = runStarts(~std::uint64_t(m_bits) & rangeMask(0, N), n);
+        return starts ? countTrailingZeros(starts) : N;
+    }
+
+    void set(std::size_t first, std::size_t n) noexcept
+    {
+        m_bits |= static_cast<word_type>(rangeMask(first, n) );
+    }
+
+    void reset(std::size_t first, std::size_t n) noexcept
+    {
+        m_bits &= static_cast<word_type>(~rangeMask(first, n) );
+    }
+
+    std::size_t count() const noexcept
+    {
+        return popCount(m_bits);
+    }
+
+    bool full() const noexcept
+    {
+        return m_bits == static_cast<word_type>(rangeMask(0, N) );
+    }
+
+    template<class F>
+    void forEachSet(F f) const
+    {
+        for(std::uint64_t bits = m_bits; bits; bits &= bits - 1)
+            f(static_cast<std::size_t>(countTrailingZeros(bits) ) );
+    }
+
+private:
+    word_type m_bits = 0;
+};
+
+template<std::size_t N>
+class SlotMap<N, false>
+{
+    enum : std::size_t
+    {
+        WORDS = (N + 63) / 64,
+        PADDING = WORDS * 64 - N
+    };
+public:
+    SlotMap() noexcept
+    {
+        std::fill(m_words, m_words + WORDS, std::uint64_t(0) );
+        //Ячейки за пределами N всегда считаются занятыми
+        if(PADDING != 0)
+            m_words[WORDS - 1] = rangeMask(64 - PADDING, PADDING);
+    }
+
+    bool test(std::size_t i) const noexcept
+    {
+        return (m_words[i / 64] >> (i % 64) ) & 1;
+    }
+
+    std::size_t findFree(std::size_t n) const noexcept
+    {
+        if(n > N)
+            return N;
+        if(n == 1)
+        {
+            std::size_t w = m_full.findFree(1);
+            return w == WORDS ? N : w * 64 + countTrailingZeros(~m_words[w]);
+        }
+        //run - длина свободной серии, заканчивающейся на границе текущего слова
+        std::size_t run = 0;
+        for(std::size_t w = 0; w < WORDS; ++w)
+        {
+            std::uint64_t word = m_words[w];
+            std::size_t low = word ? countTrailingZeros(word) : 64;
+            if(run + low >= n)
+                return w * 64 - run;
+            if(!word)
+            {
+                run += 64;
+                continue;
+            }
+            if(n <= 64)
+            {
+                std::uint64_t starts = runStarts(~word, n);
+                if(starts)
+                    return w * 64 + countTrailingZeros(starts);
+            }
+            run = countLeadingZeros(word);
+        }
+        return N;
+    }
+
+    void set(std::size_t first, std::size_t n) noexcept
+    {
+        while(n)
+        {
+            std::size_t w = first / 64;
+            std::size_t take = std::min<std::size_t>(n, 64 - first % 64);
+            m_words[w] |= rangeMask(first % 64, take);
+            if(m_words[w] == ~std::uint64_t(0) )
+                m_full.set(w, 1);
+            first += take;
+            n -= take;
+        }
+    }
+
+    void reset(std::size_t first, std::size_t n) noexcept
+    {
+        while(n)
+        {
+            std::size_t w = first / 64;
+            std::size_t take = std::min<std::size_t>(n, 64 - first % 64);
+            if(m_words[w] == ~std::uint64_t(0) )
+                m_full.reset(w, 1);
+            m_words[w] &= ~rangeMask(first % 64, take);
+            first += take;
+            n -= take;
+        }
+    }
+
+    std::size_t count() const noexcept
+    {
+        std::size_t result = 0;
+        for(std::size_t w = 0; w < WORDS; ++w)
+            result += popCount(m_words[w]);
+        return result - PADDING;
+    }
+
+    bool full() const noexcept
+    {
+        return m_full.full();
+    }
+
+    template<class F>
+    void forEachSet(F f) const
+    {
+        for(std::size_t w = 0; w < WORDS; ++w)
+        {
+            std::uint64_t bits = m_words[w];
+            if(w == WORDS - 1)
+                bits &= ~rangeMask(64 - PADDING, PADDING);
+            for(; bits; bits &= bits - 1)
+                f(w * 64 + countTrailingZeros(bits) );
+        }
+    }
+
+private:
+    std::uint64_t m_words[WORDS];
+    SlotMap<WORDS> m_full; //бит установлен - слово целиком занято
+};
+
+//Классы длин свободных серий: длины меньше 8 - отдельные классы,
+//далее по 4 класса на каждую степень двойки
+inline std::size_t runClass(std::size_t len) noexcept
+{
+    if(len < 8)
+        return len;
+    std::size_t log = 63 - countLeadingZeros(len);
+    return 8 + (log - 3) * 4 + ((len >> (log - 2) ) & 3);
+}
+
+//Наименьшая длина серии класса cls
+inline std::size_t runClassMin(std::size_t cls) noexcept
+{
+    if(cls < 8)
+        return cls;
+    std::size_t log = 3 + (cls - 8) / 4;
+    return (4 + (cls - 8) % 4) << (log - 2);
+}
+
+constexpr std::size_t floorLog2(std::size_t v)
+{
+    return v < 2 ? 0 : 1 + floorLog2(v / 2);
+}
+
+//Число классов для серий длиной до n
+constexpr std::size_t runClassCount(std::size_t n)
+{
+    return (n < 8 ? n : 8 + (floorLog2(n) - 3) * 4 + ((n >> (floorLog2(n) - 2) ) & 3) ) + 1;
+}
+
+//Наименьший беззнаковый тип для номеров ячеек 0..N (N - признак отсутствия)
+template<std::size_t N>
+using RunIndex = typename std::conditional<(N < 0xFF), std::uint8_t,
+                 typename std::conditional<(N < 0xFFFF), std::uint16_t,
+                 typename std::conditional<(N < 0xFFFFFFFF), std::uint32_t, std::uint64_t>::type>::type>::type;
+
+//Сведения о свободных сериях, хранимые в самом блоке: длина серии в ее первой и последней
+//ячейке, списки серий блока по классам длин и связи блока в общих списках классов
+template<class ChunkType, std::size_t N, bool Enabled>
+struct ChunkRuns
+{
+    using index_type = RunIndex<N>;
+    enum : std::size_t
+    {
+        CLASSES = runClassCount(N)
+    };
+
+    ChunkRuns() noexcept
+    {
+        std::fill(classHead, classHead + CLASSES, index_type(N) );
+        std::fill(chunkNext, chunkNext + CLASSES, nullptr);
+        std::fill(chunkPrev, chunkPrev + CLASSES, nullptr);
+    }
+
+    index_type length[N];
+    index_type runNext[N];
+    index_type runPrev[N];
+    index_type classHead[CLASSES];
+    ChunkType* chunkNext[CLASSES];
+    ChunkType* chunkPrev[CLASSES];
+};
+
+template<class ChunkType, std::size_t N>
+struct ChunkRuns<ChunkType, N, false>
+{
+};
+
+//Индекс свободных серий ячеек всех блоков для размещения в подходящей серии малого класса длин.
+//Для каждого класса длин хранится список блоков, имеющих серии этого класса, и битовая маска
+//непустых классов, поэтому занятие и освобождение выполняются за O(1) без выделения памяти,
+//а поиск - за O(1), кроме просмотра серий класса запроса при отсутствии серий больших классов.
+//Карта занятости блока должна отмечать свободные ячейки до вызова add
+template<class ChunkType, std::size_t N, bool Enabled>
+class FreeRunIndex
+{
+    using index_type = RunIndex<N>;
+    enum : std::size_t
+    {
+        CLASSES = runClassCount(N),
+        WORDS = (CLASSES + 63) / 64,
+        NONE = N
+    };
+public:
+    FreeRunIndex() noexcept
+    {
+        std::fill(m_heads, m_heads + CLASSES, nullptr);
+        std::fill(m_nonEmpty, m_nonEmpty + WORDS, std::uint64_t(0) );
+    }
+
+    //Поиск серии не короче n: первая серия класса n, если подходит, иначе наименьший класс,
+    //все серии которого подходят. Если таких нет, просматриваются все серии класса n,
+    //в котором могут быть и более короткие серии
+    bool find(std::size_t n, ChunkType*& chk, std::size_t& pos) const noexcept
+    {
+        if(n > N)
+            return false;
+        std::size_t cls = runClass(n);
+        std::size_t fit = cls;
+        if(runClassMin(cls) < n)
+        {
+            ChunkType* head = m_heads[cls];
+            if(head && head->length[head->classHead[cls]] >= n)
+            {
+                chk = head;
+                pos = head->classHead[cls];
+                return true;
+            }
+            ++fit;
+        }
+        fit = firstNonEmpty(fit);
+        if(fit != CLASSES)
+        {
+            chk = m_heads[fit];
+            pos = chk->classHead[fit];
+            return true;
+        }
+        if(runClassMin(cls) == n)
+            return false;
+        for(ChunkType* c = m_heads[cls]; c; c = c->chunkNext[cls])
+        {
+            for(std::size_t p = c->classHead[cls]; p != NONE; p = c->runNext[p])
+            {
+                if(c->length[p] >= n)
+                {
+                    chk = c;
+                    pos = p;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    //Добавление освобожденных ячеек [pos, pos + n) со слиянием с соседними сериями
+    void add(ChunkType* chk, std::size_t pos, std::size_t n) noexcept
+    {
+        if(!n)
+            return;
+        if(pos > 0 && !chk->states.test(pos - 1) )
+        {
+            std::size_t len = chk->length[pos - 1];
+            pos -= len;
+            n += len;
+            unlink(chk, pos);
+        }
+        if(pos + n < N && !chk->states.test(pos + n) )
+        {
+            std::size_t len = chk->length[pos + n];
+            unlink(chk, pos + n);
+            n += len;
+        }
+        link(chk, pos, n);
+    }
+
+    //Занятие n ячеек с начала свободной серии pos
+    void remove(ChunkType* chk, std::size_t pos, std::size_t n) noexcept
+    {
+        if(!n)
+            return;
+        std::size_t len = chk->length[pos];
+        assert(len >= n);
+        unlink(chk, pos);
+        if(len > n)
+            link(chk, pos + n, len - n);
+    }
+
+    //Исключение блока из списков классов
+    void removeChunk(ChunkType* chk) noexcept
+    {
+        for(std::size_t cls = 0; cls < CLASSES; ++cls)
+        {
+            if(chk->classHead[cls] == NONE)
+                continue;
+            chk->classHead[cls] = NONE;
+            unlinkChunk(chk, cls);
+        }
+    }
+
+private:
+    void link(ChunkType* chk, std::size_t pos, std::size_t len) noexcept
+    {
+        std::size_t cls = runClass(len);
+        chk->length[pos] = chk->length[pos + len - 1] = static_cast<index_type>(len);
+        index_type head = chk->classHead[cls];
+        chk->runPrev[pos] = NONE;
+        chk->runNext[pos] = head;
+        if(head != NONE)
+            chk->runPrev[head] = static_cast<index_type>(pos);
+        else
+            linkChunk(chk, cls);
+        chk->classHead[cls] = static_cast<index_type>(pos);
+    }
+
+    void unlink(ChunkType* chk, std::size_t pos) noexcept
+    {
+        std::size_t cls = runClass(chk->length[pos]);
+        index_type prev = chk->runPrev[pos];
+        index_type next = chk->runNext[pos];
+        if(prev != NONE)
+            chk->runNext[prev] = next;
+        else
+            chk->classHead[cls] = next;
+        if(next != NONE)
+            chk->runPrev[next] = prev;
+        if(chk->classHead[cls] == NONE)
+            unlinkChunk(chk, cls);
+    }
+
+    void linkChunk(ChunkType* chk, std::size_t cls) noexcept
+    {
+        chk->chunkPrev[cls] = nullptr;
+        chk->chunkNext[cls] = m_heads[cls];
+        if(m_heads[cls])
+            m_heads[cls]->chunkPrev[cls] = chk;
+        else
+            m_nonEmpty[cls / 64] |= std::uint64_t(1) << (cls % 64);
+        m_heads[cls] = chk;
+    }
+
+    void unlinkChunk(ChunkType* chk, std::size_t cls) noexcept
+    {
+        ChunkType* prev = chk->chunkPrev[cls];
+        ChunkType* next = chk->chunkNext[cls];
+        if(prev)
+            prev->chunkNext[cls] = next;
+        else
+            m_heads[cls] = next;
+        if(next)
+            next->chunkPrev[cls] = prev;
+        if(!m_heads[cls])
+            m_nonEmpty[cls / 64] &= ~(std::uint64_t(1) << (cls % 64) );
+    }
+
+    std::size_t firstNonEmpty(std::size_t cls) const noexcept
+    {
+        for(std::size_t w = cls / 64; w < WORDS; ++w)
+        {
+            std::uint64_t bits = m_nonEmpty[w];
+            if(w == cls / 64)
+                bits &= ~std::uint64_t(0) << (cls % 64);
+            if(bits)
+                return w * 64 + countTrailingZeros(bits);
+        }
+        return CLASSES;
+    }
+
+    ChunkType* m_heads[CLASSES];
+    std::uint64_t m_nonEmpty[WORDS];
+};
+
+//Индекс отключен: размещение по первой подходящей серии по карте занятости блоков
+template<class ChunkType, std::size_t N>
+class FreeRunIndex<ChunkType, N, false>
+{
+public:
+    bool find(std::size_t, ChunkType*&, std::size_t&) const noexcept {return false;}
+    void add(ChunkType*, std::size_t, std::size_t) noexcept {}
+    void remove(ChunkType*, std::size_t, std::size_t) noexcept {}
+    void removeChunk(ChunkType*) noexcept {}
+};
+
+struct NoUpstream {};
+
+//Внешний аллокатор для объектов типа T
+template<class T, class Upstream>
+struct UpstreamFor
+{
+    typedef typename std::allocator_traits<Upstream>::template rebind_alloc<T> type;
+};
+
+template<class T>
+struct UpstreamFor<T, void>
+{
+    typedef NoUpstream type;
+};
+
+//Номер блока в каталоге индексируемого аллокатора
+template<bool Indexed>
+struct ChunkId
+{
+    std::uint32_t id = 0;
+};
+
+template<>
+struct ChunkId<false>
+{
+};
+
+//Каталог блоков по номерам для компактных 32-битных индексов объектов.
+//Номера освобожденных блоков используются повторно; место под них резервируется
+//при добавлении блока, поэтому удаление блока не выделяет память
+template<class ChunkType, std::size_t N, bool Indexed>
+class ChunkDirectory
+{
+    static_assert(N < std::numeric_limits<std::uint32_t>::max(), "indexed chunks must fit 32-bit indices");
+
+public:
+    //Присваивает блоку номер; при исчерпании 32-битных индексов бросает std::bad_alloc
+    void add(ChunkType* chk)
+    {
+        if(m_freeIds.empty() )
+        {
+            //Номер блока должен оставлять индексы объектов в пределах 32 бит
+            if(m_chunks.size() >= std::numeric_limits<std::uint32_t>::max() / N)
+                throw std::bad_alloc();
+            m_chunks.push_back(nullptr);
+            try
+            {
+                m_freeIds.reserve(m_chunks.size() );
+            }
+            catch(...)
+            {
+                m_chunks.pop_back();
+                throw;
+            }
+            m_freeIds.push_back(static_cast<std::uint32_t>(m_chunks.size() - 1) );
+        }
+        chk->id = m_freeIds.back();
+        m_freeIds.pop_back();
+        m_chunks[chk->id] = chk;
+    }
+
+    void remove(ChunkType* chk) noexcept
+    {
+        m_chunks[chk->id] = nullptr;
+        m_freeIds.push_back(chk->id);
+    }
+
+    ChunkType* chunk(std::size_t id) const noexcept
+    {
+        return m_chunks[id];
+    }
+
+private:
+    std::vector<ChunkType*> m_chunks; //блоки по номерам, освобожденные номера - nullptr
+    std::vector<std::uint32_t> m_freeIds;
+};
+
+//Каталог отключен: число блоков не ограничено
+template<class ChunkType, std::size_t N>
+class ChunkDirectory<ChunkType, N, false>
+{
+public:
+    void add(ChunkType*) noexcept {}
+    void remove(ChunkType*) noexcept {}
+};
+
+}
+
+//Reserve - число заранее подготовленных запасных блоков памяти, которые фоновый поток
+//поддерживает в готовности для расширяющегося аллокатора (0 - без фонового потока).
+//Запас создается и поток запускается вызовом prime(); до этого расширения выполняются
+//синхронно. Каждый подготовленный экземпляр аллокатора держит собственный поток.
+//Копии аллокатора запас не переносят: у контейнера он готовится через сам контейнер
+//(slist::SList::prime), а стандартные контейнеры, хранящие недоступную копию,
+//выполняют расширения синхронно
+//BestFit - размещение в серии из наименьшего класса длин, все серии которого подходят, среди
+//всех блоков (по умолчанию - в первой подходящей серии первого подходящего блока). Это близкое
+//к наилучшему размещение: серия класса запроса выбирается, только если она первая в классе
+//или других подходящих серий нет. Сведения о сериях хранятся в блоке: по три номера ячейки
+//на ячейку и списки классов длин
+//Upstream - внешний аллокатор для запросов, не размещаемых в пуле (void - такие запросы
+//завершаются std::bad_alloc). Копии аллокатора не разделяют пул, а контейнеры размещают
+//массивы и через временные копии, поэтому при внешнем аллокаторе в пуле размещаются
+//только одиночные объекты, а массивы и запросы к заполненному нерасширяемому пулу
+//передаются внешнему аллокатору
+//Indexed - каталог блоков для компактных 32-битных индексов объектов (toIndex, fromIndex).
+//Число блоков ограничено так, чтобы индексы объектов помещались в 32 бита
+template<class T, std::size_t N, bool Expand = false, std::size_t Reserve = 0, bool BestFit = false,
+         class Upstream = void, bool Indexed = false>
 class Allocator
 {
-    struct Chunk
+    using UpstreamType = typename detail::UpstreamFor<T, Upstream>::type;
+    using Hybrid = std::integral_constant<bool, !std::is_void<Upstream>::value>;
+
+    static_assert(Reserve == 0 || Expand, "chunk reserve requires an expanding allocator");
+
+    struct Chunk: detail::ChunkRuns<Chunk, N, BestFit>, detail::ChunkId<Indexed>
     {
         Chunk* next = nullptr;
-        char states[N]; //флаги состояния памяти (свободна или используется)
-        char memory[N*sizeof(T)]; //память под объекты
+        detail::SlotMap<N> states; //флаги состояния памяти (свободна или используется)
+        alignas(T) char memory[N*sizeof(T)]; //память под объекты
+    };
+
+    //Запас готовых блоков, пополняемый фоновым потоком
+    struct ChunkReserve
+    {
+        ~ChunkReserve();
+        void run();
+        Chunk* take();
+
+        std::mutex mutex;
+        std::condition_variable refill;
+        Chunk* spare = nullptr;
+        std::size_t count = 0;
+        bool stop = false;
+        std::thread worker;
     };
 public:
     using size_type = std::size_t;
@@ -31,34 +665,106 @@ public:
     using const_reference = const T&;
     using value_type = T;
 
+    //Копии аллокатора не разделяют пул: аллокаторы равны, только если это один объект.
+    //При обмене контейнеров пулы обмениваются вместе с памятью. При перемещающем присваивании
+    //пул не передается (контейнеры освобождали бы старую память через временную копию),
+    //и элементы переносятся в память пула получателя
+    using propagate_on_container_swap = std::true_type;
+    using propagate_on_container_move_assignment = std::false_type;
+    using is_always_equal = std::false_type;
+
+    //Одиночные объекты всегда размещаются в пуле, поэтому обход и уплотнение пула охватывают их все
+    static constexpr bool single_objects_pooled = Expand || std::is_void<Upstream>::value;
+
     template<class U>
     struct rebind
     {
-        typedef Allocator<U, N, Expand> other;
+        typedef Allocator<U, N, Expand, Reserve, BestFit, Upstream, Indexed> other;
+    };
+
+    //Аллокатор того же вида с каталогом блоков для индексов объектов
+    template<class U>
+    struct rebind_indexed
+    {
+        typedef Allocator<U, N, Expand, Reserve, BestFit, Upstream, true> other;
     };
 
     Allocator() noexcept = default;
-    Allocator(const Allocator&) noexcept {}
+    Allocator(const Allocator& rhs) noexcept
+        : m_upstream(rhs.m_upstream)
+    {}
     template <class U>
-    Allocator(const Allocator<U, N>&) noexcept
+    Allocator(const Allocator<U, N, Expand, Reserve, BestFit, Upstream, Indexed>& rhs) noexcept
+        : m_upstream(rhs.m_upstream)
     {}
 
     Allocator(Allocator&& rhs) noexcept
+        : m_upstream(std::move(rhs.m_upstream) )
     {
         std::swap(rhs.m_head, m_head);
+        std::swap(rhs.m_reserve, m_reserve);
+        std::swap(rhs.m_directory, m_directory);
+        std::swap(rhs.m_runs, m_runs);
+        std::swap(rhs.m_overflow, m_overflow);
+    }
+
+    friend void swap(Allocator& lhs, Allocator& rhs) noexcept
+    {
+        using std::swap;
+        swap(lhs.m_head, rhs.m_head);
+        swap(lhs.m_reserve, rhs.m_reserve);
+        swap(lhs.m_directory, rhs.m_directory);
+        swap(lhs.m_runs, rhs.m_runs);
+        swap(lhs.m_upstream, rhs.m_upstream);
+        swap(lhs.m_overflow, rhs.m_overflow);
     }
 
     ~Allocator();
 
     pointer allocate(size_type n, const void* = 0);
 
-    void deallocate(pointer p, size_type n);
+    void deallocate(pointer p, size_type n) noexcept;
 
     size_type max_size() const noexcept
     {
-        return N;
+        return maxSize(Hybrid() );
+    }
+
+    //Синхронное заполнение запаса блоков и запуск потока его пополнения.
+    //Вызывается до работы с аллокатором, чтобы расширения не выполняли malloc
+    void prime();
+
+    //Число блоков памяти
+    size_type chunkCount() const noexcept;
+
+    //Обход используемых ячеек блоков [firstChunk, lastChunk) в порядке блоков и адресов
+    template<class F>
+    void forEachAllocated(F f, size_type firstChunk = 0, size_type lastChunk = size_type(-1) ) const;
+
+    //Перенос объектов из малозаполненных блоков в более заполненные и освобождение опустевших блоков.
+    //Каждая используемая ячейка считается отдельным объектом (как у узловых контейнеров).
+    //После переноса объекта и разрушения оригинала вызывается relocate(from, to); relocate не должна
+    //бросать исключений. При исключении из конструктора перемещения объект остается на месте,
+    //а уже перенесенные объекты - на новых местах. Возвращает число освобожденных блоков
+    template<class Relocate>
+    size_type compact(Relocate relocate);
+
+    //Компактный 32-битный индекс объекта пула: номер блока * N + позиция + 1 (0 - нулевой указатель).
+    //Поиск блока линеен по числу блоков
+    std::uint32_t toIndex(const_pointer p) const noexcept;
+
+    pointer fromIndex(std::uint32_t index) const noexcept
+    {
+        static_assert(Indexed, "object indices require an indexed allocator");
+        if(!index)
+            return nullptr;
+        --index;
+        return reinterpret_cast<pointer>(m_directory.chunk(index / N)->memory) + index % N;
     }
 
+    //Размещение одного объекта с получением его индекса за O(1)
+    pointer allocateIndexed(std::uint32_t& index);
+
     template<class U, class... Args>
     void construct(U* p, Args&&... args)
     {
@@ -72,122 +778,415 @@ public:
     }
 
 private:
+    static Chunk* createChunk() noexcept;
+    static void destroyChunk(Chunk* chk) noexcept;
     T* expandAndAllocate(size_type n);
-    Chunk* findChunk(pointer p);
+    pointer place(size_type n, Chunk*& owner);
+    Chunk* findChunk(const_pointer p) const noexcept;
+    void occupy(Chunk* chk, size_type pos, size_type n) noexcept;
+    void release(Chunk* chk, size_type pos, size_type n) noexcept;
+
+    static bool pooled(size_type n) noexcept
+    {
+        return Hybrid::value ? n == 1 : n <= N;
+    }
+
+    size_type maxSize(std::true_type) const noexcept
+    {
+        return std::allocator_traits<UpstreamType>::max_size(m_upstream);
+    }
+
+    size_type maxSize(std::false_type) const noexcept
+    {
+        return N;
+    }
+
+    pointer overflowAllocate(size_type n, std::true_type)
+    {
+        return std::allocator_traits<UpstreamType>::allocate(m_upstream, n);
+    }
+
+    pointer overflowAllocate(size_type, std::false_type)
+    {
+        throw std::bad_alloc();
+    }
+
+    void overflowDeallocate(pointer p, size_type n, std::true_type) noexcept
+    {
+        std::allocator_traits<UpstreamType>::deallocate(m_upstream, p, n);
+    }
+
+    void overflowDeallocate(pointer, size_type, std::false_type) noexcept
+    {
+        assert(!"pointer does not belong to the pool");
+    }
 
-    template<class T1, std::size_t N1> friend class TestAllocatorAccessor;
+    template<class T1, std::size_t N1> friend class ::TestAllocatorAccessor;
+    template<class T1, std::size_t N1, bool Expand1, std::size_t Reserve1, bool BestFit1, class Upstream1,
+             bool Indexed1>
+    friend class Allocator;
     Chunk* m_head = nullptr;
+    std::unique_ptr<ChunkReserve> m_reserve;
+    detail::ChunkDirectory<Chunk, N, Indexed> m_directory;
+    detail::FreeRunIndex<Chunk, N, BestFit> m_runs;
+    UpstreamType m_upstream;
+    size_type m_overflow = 0; //одиночные объекты, переданные внешнему аллокатору
 };
 
-template<class T, size_t N, bool Expand>
-Allocator<T, N, Expand>::~Allocator()
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::~Allocator()
 {
     while(m_head)
     {
         Chunk* ch = m_head;
         m_head = ch->next;
-        ch->~Chunk();
-        free(ch);
+        destroyChunk(ch);
     }
 }
 
-template<class T, size_t N, bool Expand>
-T* Allocator<T, N, Expand>::expandAndAllocate(size_type n)
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+typename Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::Chunk* Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::createChunk() noexcept
 {
     void* chkMem = malloc(sizeof(Chunk) );
     if(!chkMem)
-        throw std::bad_alloc();
+        return nullptr;
     Chunk* chk = reinterpret_cast<Chunk*>(chkMem);
-    new(chk) Chunk();
-    for(size_t i = 0; i < N; ++i)
-        chk->states[i] = i < n ? ALLOCATE_STATE : DEALLOCATE_STATE;
+    new(chk) Chunk;
+    return chk;
+}
+
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+void Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::destroyChunk(Chunk* chk) noexcept
+{
+    chk->~Chunk();
+    free(chk);
+}
+
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::ChunkReserve::~ChunkReserve()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    refill.notify_one();
+    if(worker.joinable() )
+        worker.join();
+    while(spare)
+    {
+        Chunk* ch = spare;
+        spare = ch->next;
+        destroyChunk(ch);
+    }
+}
+
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+void Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::ChunkReserve::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true)
+    {
+        refill.wait(lock, [this]{return stop || count < Reserve;});
+        if(stop)
+            return;
+        //Выделение и инициализация блока выполняются без блокировки
+        lock.unlock();
+        Chunk* chk = createChunk();
+        lock.lock();
+        //При нехватке памяти пополнение прекращается,
+        //дальнейшие расширения выполняются синхронно
+        if(!chk)
+            return;
+        chk->next = spare;
+        spare = chk;
+        ++count;
+    }
+}
+
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+typename Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::Chunk* Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::ChunkReserve::take()
+{
+    Chunk* chk = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(spare)
+        {
+            chk = spare;
+            spare = chk->next;
+            chk->next = nullptr;
+            --count;
+        }
+    }
+    refill.notify_one();
+    return chk;
+}
+
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+void Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::prime()
+{
+    static_assert(Reserve > 0, "prime requires a chunk reserve");
+    if(m_reserve)
+        return;
+    std::unique_ptr<ChunkReserve> reserve(new ChunkReserve() );
+    for(; reserve->count < Reserve; ++reserve->count)
+    {
+        Chunk* chk = createChunk();
+        if(!chk)
+            throw std::bad_alloc();
+        chk->next = reserve->spare;
+        reserve->spare = chk;
+    }
+    reserve->worker = std::thread(&ChunkReserve::run, reserve.get() );
+    m_reserve = std::move(reserve);
+}
+
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+T* Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::expandAndAllocate(size_type n)
+{
+    Chunk* chk = nullptr;
+    if(Reserve > 0 && m_reserve)
+        chk = m_reserve->take();
+    if(!chk)
+        chk = createChunk();
+    if(!chk)
+        throw std::bad_alloc();
+    try
+    {
+        m_directory.add(chk);
+    }
+    catch(...)
+    {
+        destroyChunk(chk);
+        throw;
+    }
     chk->next = m_head;
     m_head = chk;
+    m_runs.add(chk, 0, N);
+    occupy(chk, 0, n);
     return reinterpret_cast<T*>(m_head->memory);
 }
 
-template<class T, size_t N, bool Expand>
-typename Allocator<T, N, Expand>::pointer Allocator<T, N, Expand>::allocate(size_type n, const void*)
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+typename Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::pointer Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::allocate(size_type n, const void*)
 {
-    if(n > N)
-        throw std::bad_alloc();
-    if(!m_head)
+    Chunk* owner = nullptr;
+    return place(n, owner);
+}
+
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+typename Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::pointer Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::allocateIndexed(std::uint32_t& index)
+{
+    static_assert(Indexed, "object indices require an indexed allocator");
+    static_assert(single_objects_pooled, "object indices require all single objects to be placed in the pool");
+    Chunk* owner = nullptr;
+    pointer p = place(1, owner);
+    index = static_cast<std::uint32_t>(owner->id * N + (p - reinterpret_cast<pointer>(owner->memory) ) + 1);
+    return p;
+}
+
+//Размещение в пуле; owner - блок, в котором размещены объекты (nullptr для внешнего аллокатора)
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+typename Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::pointer Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::place(size_type n, Chunk*& owner)
+{
+    if(!pooled(n) )
+        return overflowAllocate(n, Hybrid() );
+    if(BestFit)
     {
-        return expandAndAllocate(n);
+        Chunk* chk = nullptr;
+        size_type pos = 0;
+        if(m_runs.find(n, chk, pos) )
+        {
+            occupy(chk, pos, n);
+            owner = chk;
+            return reinterpret_cast<T*>(chk->memory) + pos;
+        }
     }
     else
     {
         auto chk = m_head;
         while(chk)
         {
-            char* lptr = chk->states;
-            auto rptr = lptr;
-            auto end = lptr+N;
-            while(rptr != end)
+            size_type pos = chk->states.findFree(n);
+            if(pos != N)
             {
-                if(*rptr == ALLOCATE_STATE)
-                    lptr = ++rptr;
-                else
-                    if(static_cast<size_t>(++rptr-lptr) == n)
-                    {
-                        auto result = reinterpret_cast<T*>(chk->memory) + (lptr - chk->states);
-                        while(lptr != rptr)
-                            *lptr++ = ALLOCATE_STATE;
-                        return result;
-                    }
+                occupy(chk, pos, n);
+                owner = chk;
+                return reinterpret_cast<T*>(chk->memory) + pos;
             }
             chk = chk->next;
         }
-        if(Expand)
+    }
+    if(Expand || !m_head)
+    {
+        pointer result = expandAndAllocate(n);
+        owner = m_head;
+        return result;
+    }
+    pointer result = overflowAllocate(n, Hybrid() );
+    ++m_overflow;
+    return result;
+}
+
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+typename Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::size_type Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::chunkCount() const noexcept
+{
+    size_type result = 0;
+    for(Chunk* chk = m_head; chk; chk = chk->next)
+        ++result;
+    return result;
+}
+
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+template<class F>
+void Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::forEachAllocated(F f, size_type firstChunk, size_type lastChunk) const
+{
+    Chunk* chk = m_head;
+    for(size_type i = 0; chk && i < lastChunk; ++i, chk = chk->next)
+    {
+        if(i < firstChunk)
+            continue;
+        pointer memory = reinterpret_cast<pointer>(chk->memory);
+        chk->states.forEachSet([&f, memory](size_type pos){f(memory + pos);});
+    }
+}
+
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+template<class Relocate>
+typename Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::size_type Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::compact(Relocate relocate)
+{
+    std::vector<std::pair<size_type, Chunk*>> chunks; //число свободных ячеек, блок
+    for(Chunk* chk = m_head; chk; chk = chk->next)
+        chunks.emplace_back(N - chk->states.count(), chk);
+    //Сначала наиболее заполненные блоки - получатели, в конце малозаполненные - источники
+    std::stable_sort(chunks.begin(), chunks.end(),
+        [](const std::pair<size_type, Chunk*>& lhs, const std::pair<size_type, Chunk*>& rhs)
+        {return lhs.first < rhs.first;});
+
+    if(!chunks.empty() )
+    {
+        size_type dst = 0;
+        size_type src = chunks.size() - 1;
+        size_type capacity = 0; //свободные ячейки блоков-получателей [dst, src)
+        for(size_type i = 0; i < src; ++i)
+            capacity += chunks[i].first;
+        std::vector<size_type> positions;
+        positions.reserve(N);
+        //Блок-источник переносится, только если освободится целиком
+        while(dst < src && capacity >= N - chunks[src].first)
         {
-            return expandAndAllocate(n);
+            Chunk* from = chunks[src].second;
+            positions.clear();
+            from->states.forEachSet([&positions](size_type pos){positions.push_back(pos);});
+            for(size_type pos : positions)
+            {
+                while(!chunks[dst].first)
+                    ++dst;
+                Chunk* to = chunks[dst].second;
+                size_type free = to->states.findFree(1);
+                pointer oldPtr = reinterpret_cast<pointer>(from->memory) + pos;
+                pointer newPtr = reinterpret_cast<pointer>(to->memory) + free;
+                ::new((void *)newPtr) T(std::move(*oldPtr) );
+                oldPtr->~T();
+                occupy(to, free, 1);
+                release(from, pos, 1);
+                --chunks[dst].first;
+                --capacity;
+                relocate(oldPtr, newPtr);
+            }
+            chunks[src].first = N;
+            --src;
+            capacity -= chunks[src].first;
         }
-        else
+    }
+
+    size_type result = 0;
+    Chunk** link = &m_head;
+    while(*link)
+    {
+        Chunk* chk = *link;
+        if(chk->states.count() )
         {
-            throw std::bad_alloc();
+            link = &chk->next;
+            continue;
         }
+        *link = chk->next;
+        m_directory.remove(chk);
+        m_runs.removeChunk(chk);
+        destroyChunk(chk);
+        ++result;
     }
+    return result;
+}
+
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+std::uint32_t Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::toIndex(const_pointer p) const noexcept
+{
+    static_assert(Indexed, "object indices require an indexed allocator");
+    if(!p)
+        return 0;
+    Chunk* chk = findChunk(p);
+    assert(chk);
+    return static_cast<std::uint32_t>(chk->id * N + (p - reinterpret_cast<const_pointer>(chk->memory) ) + 1);
+}
+
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+void Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::occupy(Chunk* chk, size_type pos, size_type n) noexcept
+{
+    chk->states.set(pos, n);
+    m_runs.remove(chk, pos, n);
+}
+
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+void Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::release(Chunk* chk, size_type pos, size_type n) noexcept
+{
+    chk->states.reset(pos, n);
+    m_runs.add(chk, pos, n);
 }
 
-template<class T, size_t N, bool Expand>
-typename Allocator<T, N, Expand>::Chunk* Allocator<T, N, Expand>::findChunk(pointer p)
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+typename Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::Chunk* Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::findChunk(const_pointer p) const noexcept
 {
+    std::less<const_pointer> less;
     Chunk* chk = m_head;
     while(chk)
     {
-        pointer ptr = reinterpret_cast<pointer>(chk->memory);
-        for(size_t i = 0; i < N; ++i)
-        {
-            if(ptr == p)
-                return chk;
-            ++ptr;
-        }
+        const_pointer ptr = reinterpret_cast<const_pointer>(chk->memory);
+        if(!less(p, ptr) && less(p, ptr + N) )
+            return chk;
         chk = chk->next;
     }
     return nullptr;
 }
 
-template<class T, size_t N, bool Expand>
-void Allocator<T, N, Expand>::deallocate(pointer p, size_type n)
+template<class T, size_t N, bool Expand, size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+void Allocator<T, N, Expand, Reserve, BestFit, Upstream, Indexed>::deallocate(pointer p, size_type n) noexcept
 {
+    if(!pooled(n) )
+    {
+        overflowDeallocate(p, n, Hybrid() );
+        return;
+    }
     Chunk* chk = findChunk(p);
-    assert(chk);
-    auto shift = p - reinterpret_cast<pointer>(chk->memory);
-    char* lptr = chk->states + shift;
-    char* rptr = lptr + n;
-    while(lptr != rptr)
-        *lptr++ = DEALLOCATE_STATE;
+    if(!chk)
+    {
+        //Вне пула допустим только объект, выделенный при заполненном нерасширяемом пуле
+        assert(m_overflow > 0 && "pointer does not belong to the pool");
+        --m_overflow;
+        overflowDeallocate(p, n, Hybrid() );
+        return;
+    }
+    release(chk, p - reinterpret_cast<pointer>(chk->memory), n);
 }
 
-template<class T, std::size_t N>
+template<class T, std::size_t N, bool Expand, std::size_t Reserve, bool BestFit, class Upstream, bool Indexed>
   inline bool
-  operator==(const allocator::Allocator<T,N>&, const allocator::Allocator<T,N>&)
-  { return true; }
+  operator==(const allocator::Allocator<T,N,Expand,Reserve,BestFit,Upstream,Indexed>& lhs, const allocator::Allocator<T,N,Expand,Reserve,BestFit,Upstream,Indexed>& rhs)
+  { return &lhs == &rhs; }
 
-template<class T, std::size_t N>
+template<class T, std::size_t N, bool Expand, std::size_t Reserve, bool BestFit, class Upstream, bool Indexed>
   inline bool
-  operator!=(const allocator::Allocator<T,N>&, const allocator::Allocator<T,N>&)
-  { return false; }
+  operator!=(const allocator::Allocator<T,N,Expand,Reserve,BestFit,Upstream,Indexed>& lhs, const allocator::Allocator<T,N,Expand,Reserve,BestFit,Upstream,Indexed>& rhs)
+  { return !(lhs == rhs); }
 
 }
 
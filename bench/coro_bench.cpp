@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <coroutine>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <new>
+#include <utility>
+#include <vector>
+#include "framepool.h"
+
+//Сравнение стоимости размещения кадров сопрограмм глобальным operator new и пулами FramePool
+
+namespace
+{
+
+std::size_t heapAllocations = 0;
+
+}
+
+void* operator new(std::size_t size)
+{
+    ++heapAllocations;
+    if(void* p = std::malloc(size ? size : 1) )
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+
+struct DefaultAllocated {};
+
+template<class Base>
+struct Task
+{
+    struct promise_type: Base
+    {
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this) );
+        }
+        std::suspend_always initial_suspend() noexcept {return {};}
+        std::suspend_always final_suspend() noexcept {return {};}
+        void return_value(int v) noexcept {value = v;}
+        void unhandled_exception() {std::terminate();}
+
+        int value = 0;
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> handle) noexcept
+        : handle(handle) {}
+
+    Task(Task&& rhs) noexcept
+        : handle(std::exchange(rhs.handle, nullptr) ) {}
+
+    ~Task()
+    {
+        if(handle)
+            handle.destroy();
+    }
+
+    int run()
+    {
+        handle.resume();
+        return handle.promise().value;
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+//Обработчик запроса с несколькими сотнями байт состояния в кадре
+template<class Base>
+Task<Base> handleRequest(int id)
+{
+    int buffer[64];
+    for(int i = 0; i < 64; ++i)
+        buffer[i] = id + i;
+    co_await std::suspend_never{};
+    int sum = 0;
+    for(int v : buffer)
+        sum += v;
+    co_return sum;
+}
+
+template<class Base>
+void bench(const char* name, int rounds, int inFlight)
+{
+    std::vector<Task<Base>> tasks;
+    tasks.reserve(inFlight);
+    long long sink = 0;
+    auto runRound = [&]()
+    {
+        for(int i = 0; i < inFlight; ++i)
+            tasks.push_back(handleRequest<Base>(i) );
+        for(auto& task : tasks)
+            sink += task.run();
+        tasks.clear();
+    };
+
+    runRound();
+    std::size_t allocations = heapAllocations;
+    auto start = std::chrono::steady_clock::now();
+    for(int round = 0; round < rounds; ++round)
+        runRound();
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    double coroutines = static_cast<double>(rounds) * inFlight;
+
+    std::cout << name << ": " << elapsed / coroutines << " ns/coroutine, "
+              << (heapAllocations - allocations) / coroutines << " heap allocations/coroutine"
+              << " (checksum " << sink << ")" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = argc > 1 ? std::atoi(argv[1]) : 2000;
+    int inFlight = argc > 2 ? std::atoi(argv[2]) : 1000;
+    //Большое число одновременно живущих кадров при том же общем числе сопрограмм
+    int manyInFlight = argc > 3 ? std::atoi(argv[3]) : 100000;
+    int manyRounds = std::max(1, static_cast<int>(static_cast<long long>(rounds) * inFlight / manyInFlight) );
+
+    std::cout << inFlight << " in flight" << std::endl;
+    bench<DefaultAllocated>("operator new", rounds, inFlight);
+    bench<allocator::PoolAllocated<>>("FramePool   ", rounds, inFlight);
+    std::cout << manyInFlight << " in flight" << std::endl;
+    bench<DefaultAllocated>("operator new", manyRounds, manyInFlight);
+    bench<allocator::PoolAllocated<>>("FramePool   ", manyRounds, manyInFlight);
+    return 0;
+}
@@ -0,0 +1,244 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include "allocator.h"
+
+namespace allocator
+{
+
+//Пулы блоков памяти по классам размеров для кадров сопрограмм C++20 и объектов обратного вызова.
+//Классы размеров кратны Granularity и не превышают MaxSize. Освобожденный блок помещается
+//в интрузивный список свободных блоков своего класса, а новые блоки нарезаются последовательно
+//из участков не менее чем по ChunkSize блоков. Размещение и освобождение выполняются за O(1)
+//независимо от числа блоков в использовании. Более крупные запросы обслуживает глобальный operator new.
+//Участки выровнены по своему размеру, поэтому пул-владелец блока находится по адресу блока.
+//Блок можно освобождать в любом потоке: блок чужого пула возвращается владельцу через список
+//под мьютексом, который владелец забирает при следующем размещении. Состояние пулов переживает
+//поток-владелец (и сам объект FramePool), пока его блоки используются
+template<std::size_t MaxSize = 1024, std::size_t Granularity = 64, std::size_t ChunkSize = 256>
+class FramePool
+{
+    static_assert(Granularity > 0 && MaxSize % Granularity == 0, "MaxSize must be a multiple of Granularity");
+    static_assert(ChunkSize > 0, "chunk must contain at least one block");
+
+    struct Heap;
+
+    //Заголовок участка
+    struct Chunk
+    {
+        Heap* owner;
+        Chunk* next; //следующий участок владельца
+        void* raw; //адрес, полученный от malloc
+    };
+
+    enum : std::size_t
+    {
+        CLASSES = MaxSize / Granularity,
+        ALIGN = alignof(std::max_align_t),
+        HEADER = (sizeof(Chunk) + ALIGN - 1) / ALIGN * ALIGN
+    };
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    struct SizeClass
+    {
+        FreeBlock* free = nullptr; //освобожденные блоки
+        char* bump = nullptr; //еще не выданная часть текущего участка
+        char* end = nullptr;
+    };
+
+    struct Heap
+    {
+        SizeClass classes[CLASSES];
+        Chunk* chunks = nullptr;
+        std::size_t live = 0; //выданные блоки; после ухода владельца изменяется под мьютексом
+        std::mutex mutex;
+        FreeBlock* remote[CLASSES] = {}; //блоки, освобожденные через другие пулы
+        std::atomic<bool> pending{false}; //есть блоки в remote
+        bool abandoned = false; //владелец разрушен, состояние освобождает последний блок
+    };
+
+public:
+    FramePool()
+        : m_heap(new Heap)
+    {}
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    ~FramePool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_heap->mutex);
+            collectRemote(*m_heap);
+            if(m_heap->live)
+            {
+                m_heap->abandoned = true;
+                return;
+            }
+        }
+        destroyHeap(m_heap);
+    }
+
+    //Пулы текущего потока
+    static FramePool& local()
+    {
+        thread_local FramePool pool;
+        return pool;
+    }
+
+    void* allocate(std::size_t size)
+    {
+        if(size > MaxSize)
+            return ::operator new(size);
+        std::size_t cls = sizeClass(size);
+        SizeClass& sc = m_heap->classes[cls];
+        if(!sc.free && sc.bump == sc.end && m_heap->pending.load(std::memory_order_relaxed) )
+        {
+            std::lock_guard<std::mutex> lock(m_heap->mutex);
+            collectRemote(*m_heap);
+        }
+        void* result = sc.free;
+        if(result)
+            sc.free = sc.free->next;
+        else
+        {
+            if(sc.bump == sc.end)
+                addChunk(sc, cls);
+            result = sc.bump;
+            sc.bump += blockSize(cls);
+        }
+        ++m_heap->live;
+        return result;
+    }
+
+    void deallocate(void* p, std::size_t size) noexcept
+    {
+        if(size > MaxSize)
+        {
+            ::operator delete(p, size);
+            return;
+        }
+        std::size_t cls = sizeClass(size);
+        Heap* owner = chunkOf(p, cls)->owner;
+        FreeBlock* block = ::new(p) FreeBlock;
+        if(owner == m_heap)
+        {
+            SizeClass& sc = m_heap->classes[cls];
+            block->next = sc.free;
+            sc.free = block;
+            --m_heap->live;
+            return;
+        }
+        std::unique_lock<std::mutex> lock(owner->mutex);
+        if(owner->abandoned)
+        {
+            if(--owner->live)
+                return;
+            lock.unlock();
+            destroyHeap(owner);
+            return;
+        }
+        block->next = owner->remote[cls];
+        owner->remote[cls] = block;
+        owner->pending.store(true, std::memory_order_relaxed);
+    }
+
+private:
+    static std::size_t sizeClass(std::size_t size) noexcept
+    {
+        return size ? (size - 1) / Granularity : 0;
+    }
+
+    //Размер блока класса с выравниванием по max_align_t
+    static std::size_t blockSize(std::size_t cls) noexcept
+    {
+        return ((cls + 1) * Granularity + ALIGN - 1) / ALIGN * ALIGN;
+    }
+
+    //Размер участка класса - степень двойки, по которой участок выровнен
+    static std::size_t chunkBytes(std::size_t cls) noexcept
+    {
+        return std::size_t(1) << (64 - detail::countLeadingZeros(HEADER + ChunkSize * blockSize(cls) - 1) );
+    }
+
+    static Chunk* chunkOf(void* p, std::size_t cls) noexcept
+    {
+        return reinterpret_cast<Chunk*>(reinterpret_cast<std::uintptr_t>(p) & ~(chunkBytes(cls) - 1) );
+    }
+
+    void addChunk(SizeClass& sc, std::size_t cls)
+    {
+        std::size_t bytes = chunkBytes(cls);
+        //malloc не гарантирует выравнивания по размеру участка, поэтому берется запас
+        void* raw = std::malloc(2 * bytes - ALIGN);
+        if(!raw)
+            throw std::bad_alloc();
+        std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(raw) + bytes - 1) & ~(bytes - 1);
+        Chunk* chk = reinterpret_cast<Chunk*>(aligned);
+        chk->owner = m_heap;
+        chk->next = m_heap->chunks;
+        chk->raw = raw;
+        m_heap->chunks = chk;
+        sc.bump = reinterpret_cast<char*>(chk) + HEADER;
+        sc.end = sc.bump + (bytes - HEADER) / blockSize(cls) * blockSize(cls);
+    }
+
+    //Перенос блоков, освобожденных через другие пулы, в списки свободных блоков. Вызывается под мьютексом
+    static void collectRemote(Heap& heap) noexcept
+    {
+        for(std::size_t cls = 0; cls < CLASSES; ++cls)
+        {
+            while(FreeBlock* block = heap.remote[cls])
+            {
+                heap.remote[cls] = block->next;
+                block->next = heap.classes[cls].free;
+                heap.classes[cls].free = block;
+                --heap.live;
+            }
+        }
+        heap.pending.store(false, std::memory_order_relaxed);
+    }
+
+    static void destroyHeap(Heap* heap) noexcept
+    {
+        while(Chunk* chk = heap->chunks)
+        {
+            heap->chunks = chk->next;
+            std::free(chk->raw);
+        }
+        delete heap;
+    }
+
+    Heap* m_heap;
+};
+
+//База для типов promise сопрограмм и объектов обратного вызова:
+//кадр сопрограммы или объект размещается в пулах FramePool текущего потока
+//и может быть освобожден в любом потоке.
+//Для полиморфных объектов деструктор базового класса должен быть виртуальным
+template<class Pool = FramePool<>>
+struct PoolAllocated
+{
+    static void* operator new(std::size_t size)
+    {
+        return Pool::local().allocate(size);
+    }
+
+    static void operator delete(void* p, std::size_t size) noexcept
+    {
+        Pool::local().deallocate(p, size);
+    }
+};
+
+}
+
+#endif
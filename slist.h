@@ -2,10 +2,86 @@
 #define SLIST_H
 
 #include <memory>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
 
 namespace slist
 {
 
+namespace detail
+{
+
+template<class T>
+struct MakeVoid
+{
+    typedef void type;
+};
+
+//Аллокатор умеет обходить используемые ячейки в порядке размещения в памяти
+//и все одиночные объекты размещает в своем пуле
+template<class Alloc, class = void>
+struct HasPoolTraversal: std::false_type {};
+
+template<class Alloc>
+struct HasPoolTraversal<Alloc,
+        typename MakeVoid<decltype(std::declval<const Alloc&>().chunkCount() )>::type>
+    : std::integral_constant<bool, Alloc::single_objects_pooled> {};
+
+//Число рабочих потоков (0 - по числу ядер)
+inline std::size_t workerCount(std::size_t threads)
+{
+    if(!threads)
+        threads = std::thread::hardware_concurrency();
+    return std::max<std::size_t>(threads, 1);
+}
+
+//Вызов fn(part, first, last) для равных частей диапазона [0, count) в threads потоках,
+//исключения из потоков передаются вызывающему
+template<class Fn>
+void parallelRun(std::size_t count, std::size_t threads, Fn fn)
+{
+    threads = std::max<std::size_t>(std::min(threads, count), 1);
+    std::vector<std::exception_ptr> errors(threads);
+    auto task = [&fn, &errors, count, threads](std::size_t part)
+    {
+        try
+        {
+            fn(part, count * part / threads, count * (part + 1) / threads);
+        }
+        catch(...)
+        {
+            errors[part] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    try
+    {
+        for(std::size_t part = 1; part < threads; ++part)
+            workers.emplace_back(task, part);
+    }
+    catch(...)
+    {
+        for(auto& worker : workers)
+            worker.join();
+        throw;
+    }
+    task(0);
+    for(auto& worker : workers)
+        worker.join();
+    for(auto& error : errors)
+        if(error)
+            std::rethrow_exception(error);
+}
+
+}
+
 struct BaseNode
 {
     BaseNode* next = nullptr;
@@ -168,7 +244,15 @@ public:
     void addItem(Arg&&... args)
     {
         auto node = m_alloc.allocate(1);
-        m_alloc.construct(node, std::forward<Arg>(args)...);
+        try
+        {
+            m_alloc.construct(node, std::forward<Arg>(args)...);
+        }
+        catch(...)
+        {
+            m_alloc.deallocate(node, 1);
+            throw;
+        }
         if(!m_tail)
         {
             m_head = node;
@@ -181,6 +265,76 @@ public:
         }
     }
 
+    //Подготовка запаса блоков аллокатора узлов с фоновым пополнением (allocator::Allocator::prime).
+    //Аллокатор списка - собственная копия, поэтому запас готовится через список
+    void prime()
+    {
+        m_alloc.prime();
+    }
+
+    //Аллокатор узлов списка
+    const AllocType& getAllocator() const noexcept
+    {
+        return m_alloc;
+    }
+
+    //Удаление элементов, удовлетворяющих pred. Возвращает число удаленных элементов
+    template<class Pred>
+    std::size_t removeIf(Pred pred)
+    {
+        std::size_t result = 0;
+        BaseNode* prev = nullptr;
+        BaseNode* ptr = m_head;
+        while(ptr)
+        {
+            BaseNode* next = ptr->next;
+            if(pred(static_cast<Node<T>*>(ptr)->value) )
+            {
+                if(prev)
+                    prev->next = next;
+                else
+                    m_head = next;
+                if(m_tail == ptr)
+                    m_tail = prev;
+                m_alloc.destroy(static_cast<Node<T>*>(ptr) );
+                m_alloc.deallocate(static_cast<Node<T>*>(ptr), 1);
+                ++result;
+            }
+            else
+            {
+                prev = ptr;
+            }
+            ptr = next;
+        }
+        return result;
+    }
+
+    //Уплотнение памяти аллокатора с перепривязкой перенесенных узлов.
+    //Возвращает число освобожденных блоков памяти. Место под сведения о переносах
+    //выделяется заранее, поэтому при исключении из конструктора перемещения элемента
+    //уже перенесенные узлы перепривязываются и список остается целым
+    std::size_t compact()
+    {
+        std::size_t count = 0;
+        for(auto ptr = m_head; ptr; ptr = ptr->next)
+            ++count;
+        std::vector<std::pair<BaseNode*, BaseNode*>> moved;
+        moved.reserve(count);
+        std::size_t result = 0;
+        try
+        {
+            result = m_alloc.compact([&moved](Node<T>* from, Node<T>* to) noexcept
+                {moved.emplace_back(from, to);});
+        }
+        catch(...)
+        {
+            relink(moved);
+            throw;
+        }
+        relink(moved);
+        return result;
+    }
+
     bool isEmpty() const {return !m_head;}
 
     iterator begin() {return SListIterator<T>(m_head);}
@@ -188,12 +342,306 @@ public:
     const_iterator begin() const {return ConstSListIterator<T>(m_head);}
     const_iterator end() const {return ConstSListIterator<T>();}
 
+    //Обход элементов в порядке их размещения в памяти, если аллокатор это поддерживает,
+    //иначе в порядке списка. Порядок элементов не гарантируется
+    template<class F>
+    void unorderedForEach(F f)
+    {
+        forEachNode([&f](Node<T>* node){f(node->value);}, PoolTraversal() );
+    }
+
+    //Параллельный обход элементов в threads потоках (0 - по числу ядер),
+    //f вызывается одновременно из нескольких потоков
+    template<class F>
+    void parallelForEach(F f, std::size_t threads = 0)
+    {
+        parallelForEachPart([&f](std::size_t, auto forEachInPart)
+        {
+            forEachInPart([&f](Node<T>* node){f(node->value);});
+        }, detail::workerCount(threads), PoolTraversal() );
+    }
+
+    //Свертка op(acc, value) в порядке размещения элементов в памяти
+    template<class R, class Op>
+    R unorderedReduce(R init, Op op) const
+    {
+        forEachNode([&init, &op](Node<T>* node){init = op(std::move(init), node->value);}, PoolTraversal() );
+        return init;
+    }
+
+    //Параллельная свертка: каждый поток сворачивает свою часть элементов через op,
+    //начиная с identity, частичные результаты объединяются через combine
+    template<class R, class Op, class Combine>
+    R parallelReduce(R identity, Op op, Combine combine, std::size_t threads = 0) const
+    {
+        struct Partial
+        {
+            R value;
+        };
+        std::vector<Partial> partials(detail::workerCount(threads), Partial{identity});
+        parallelForEachPart([&partials, &op](std::size_t part, auto forEachInPart)
+        {
+            R acc = partials[part].value;
+            forEachInPart([&acc, &op](Node<T>* node){acc = op(std::move(acc), node->value);});
+            partials[part].value = std::move(acc);
+        }, partials.size(), PoolTraversal() );
+        for(auto& partial : partials)
+            identity = combine(std::move(identity), std::move(partial.value) );
+        return identity;
+    }
+
     template<class T1, class Alloc1> friend class SList;
 private:
+    using PoolTraversal = detail::HasPoolTraversal<AllocType>;
+
+    template<class F>
+    void forEachNode(F f, std::true_type) const
+    {
+        m_alloc.forEachAllocated(f);
+    }
+
+    template<class F>
+    void forEachNode(F f, std::false_type) const
+    {
+        for(auto ptr = m_head; ptr; ptr = ptr->next)
+            f(static_cast<Node<T>*>(ptr) );
+    }
+
+    //Замена перенесенных узлов в ссылках списка
+    void relink(std::vector<std::pair<BaseNode*, BaseNode*>>& moved) noexcept
+    {
+        if(moved.empty() )
+            return;
+        std::less<BaseNode*> less;
+        std::sort(moved.begin(), moved.end(),
+            [&less](const std::pair<BaseNode*, BaseNode*>& lhs, const std::pair<BaseNode*, BaseNode*>& rhs)
+            {return less(lhs.first, rhs.first);});
+        auto target = [&moved, &less](BaseNode* node)
+        {
+            auto itr = std::lower_bound(moved.begin(), moved.end(), node,
+                [&less](const std::pair<BaseNode*, BaseNode*>& item, BaseNode* value)
+                {return less(item.first, value);});
+            return itr != moved.end() && itr->first == node ? itr->second : node;
+        };
+        m_head = target(m_head);
+        m_tail = target(m_tail);
+        for(auto ptr = m_head; ptr; ptr = ptr->next)
+            ptr->next = target(ptr->next);
+    }
+
+    //Части для параллельного обхода - диапазоны блоков аллокатора
+    template<class F>
+    void parallelForEachPart(F f, std::size_t threads, std::true_type) const
+    {
+        detail::parallelRun(m_alloc.chunkCount(), threads,
+            [this, &f](std::size_t part, std::size_t first, std::size_t last)
+            {
+                f(part, [this, first, last](auto g){m_alloc.forEachAllocated(g, first, last);});
+            });
+    }
+
+    //Части для параллельного обхода - диапазоны предварительно собранных узлов
+    template<class F>
+    void parallelForEachPart(F f, std::size_t threads, std::false_type) const
+    {
+        std::vector<Node<T>*> nodes;
+        forEachNode([&nodes](Node<T>* node){nodes.push_back(node);}, std::false_type() );
+        detail::parallelRun(nodes.size(), threads,
+            [&nodes, &f](std::size_t part, std::size_t first, std::size_t last)
+            {
+                f(part, [&nodes, first, last](auto g)
+                {
+                    for(std::size_t i = first; i < last; ++i)
+                        g(nodes[i]);
+                });
+            });
+    }
+
     BaseNode* m_head = nullptr;
     BaseNode* m_tail = nullptr;
     AllocType m_alloc;
 };
 
+//Узел со ссылкой на следующий узел в виде 32-битного индекса в пуле аллокатора
+template<class T>
+struct IndexNode
+{
+    explicit IndexNode(const T& v):
+        value(v){}
+    std::uint32_t next = 0;
+    T value;
+};
+
+template<class T, class AllocType>
+struct IndexSListIterator
+{
+    typedef std::forward_iterator_tag iterator_category;
+
+    IndexSListIterator() = default;
+
+    IndexSListIterator(IndexNode<T>* node, const AllocType* alloc) noexcept
+        : node(node), alloc(alloc) { }
+
+    T& operator*() const noexcept
+    {
+        return node->value;
+    }
+
+    T* operator->() const noexcept
+    {
+        return &node->value;
+    }
+
+    IndexSListIterator& operator++() noexcept
+    {
+        node = alloc->fromIndex(node->next);
+        return *this;
+    }
+
+    IndexSListIterator operator++(int) noexcept
+    {
+        IndexSListIterator tmp = *this;
+        node = alloc->fromIndex(node->next);
+        return tmp;
+    }
+
+    bool operator==(const IndexSListIterator& rhs) const noexcept
+    { return node == rhs.node; }
+
+    bool operator!=(const IndexSListIterator& rhs) const noexcept
+    { return node != rhs.node; }
+
+    IndexNode<T>* node = nullptr;
+    const AllocType* alloc = nullptr;
+};
+
+template<class T, class AllocType>
+struct ConstIndexSListIterator
+{
+    typedef std::forward_iterator_tag iterator_category;
+
+    ConstIndexSListIterator() = default;
+
+    ConstIndexSListIterator(IndexNode<T>* node, const AllocType* alloc) noexcept
+        : node(node), alloc(alloc) { }
+
+    const T& operator*() const noexcept
+    {
+        return node->value;
+    }
+
+    const T* operator->() const noexcept
+    {
+        return &node->value;
+    }
+
+    ConstIndexSListIterator& operator++() noexcept
+    {
+        node = alloc->fromIndex(node->next);
+        return *this;
+    }
+
+    ConstIndexSListIterator operator++(int) noexcept
+    {
+        ConstIndexSListIterator tmp = *this;
+        node = alloc->fromIndex(node->next);
+        return tmp;
+    }
+
+    bool operator==(const ConstIndexSListIterator& rhs) const noexcept
+    { return node == rhs.node; }
+
+    bool operator!=(const ConstIndexSListIterator& rhs) const noexcept
+    { return node != rhs.node; }
+
+    IndexNode<T>* node = nullptr;
+    const AllocType* alloc = nullptr;
+};
+
+//Список с компактными узлами для пулового аллокатора (allocator::Allocator):
+//ссылки между узлами хранятся как 32-битные индексы, разрешаемые через аллокатор
+//с каталогом блоков (rebind_indexed)
+template<class T, class Alloc>
+class IndexSList
+{
+    using AllocType = typename Alloc::template rebind_indexed<IndexNode<T>>::other;
+    static_assert(AllocType::single_objects_pooled, "index links require all nodes to be placed in the pool");
+public:
+    typedef IndexSListIterator<T, AllocType> iterator;
+    typedef ConstIndexSListIterator<T, AllocType> const_iterator;
+
+    IndexSList() = default;
+
+    IndexSList(const IndexSList& rhs)
+    {
+        for(const auto& value : rhs)
+            addItem(value);
+    }
+
+    IndexSList(IndexSList&& rhs) noexcept
+        : m_alloc(std::move(rhs.m_alloc) )
+    {
+        std::swap(m_head, rhs.m_head);
+        std::swap(m_tail, rhs.m_tail);
+    }
+
+    ~IndexSList()
+    {
+        while(m_head)
+        {
+            auto ptr = m_head;
+            m_head = m_alloc.fromIndex(m_head->next);
+            m_alloc.destroy(ptr);
+            m_alloc.deallocate(ptr, 1);
+        }
+    }
+
+    template<class... Arg>
+    void addItem(Arg&&... args)
+    {
+        std::uint32_t index = 0;
+        auto node = m_alloc.allocateIndexed(index);
+        try
+        {
+            m_alloc.construct(node, std::forward<Arg>(args)...);
+        }
+        catch(...)
+        {
+            m_alloc.deallocate(node, 1);
+            throw;
+        }
+        if(!m_tail)
+            m_head = node;
+        else
+            m_tail->next = index;
+        m_tail = node;
+    }
+
+    bool isEmpty() const {return !m_head;}
+
+    //Подготовка запаса блоков аллокатора узлов с фоновым пополнением (allocator::Allocator::prime)
+    void prime()
+    {
+        m_alloc.prime();
+    }
+
+    iterator begin() {return iterator(m_head, &m_alloc);}
+    iterator end() {return iterator(nullptr, &m_alloc);}
+    const_iterator begin() const {return const_iterator(m_head, &m_alloc);}
+    const_iterator end() const {return const_iterator(nullptr, &m_alloc);}
+
+    //Обход элементов в порядке их размещения в памяти пула
+    template<class F>
+    void unorderedForEach(F f)
+    {
+        m_alloc.forEachAllocated([&f](IndexNode<T>* node){f(node->value);});
+    }
+
+private:
+    IndexNode<T>* m_head = nullptr;
+    IndexNode<T>* m_tail = nullptr;
+    AllocType m_alloc;
+};
+
 }
 #endif
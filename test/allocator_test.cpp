@@ -3,6 +3,13 @@
 #include "testallocatoraccessor.h"
 #include <string>
 #include <map>
+#include <set>
+#include <list>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <unordered_map>
 
 class TestValueType
 {
@@ -275,3 +282,391 @@ TEST(ALLOCATOR_TEST, map_expand_test)
     ASSERT_NO_THROW(values.emplace(4,4) );
     ASSERT_NO_THROW(values.emplace(5,5) );
 }
+
+TEST(ALLOCATOR_TEST, reserve_expand_test)
+{
+    allocator::Allocator<int, 4, true, 2> alloc;
+    ASSERT_EQ((TestAllocatorAccessor<int,4>::getSpareCount(&alloc) ), 0);
+
+    //Без prime() расширения выполняются синхронно
+    int* first = alloc.allocate(1);
+    ASSERT_EQ((TestAllocatorAccessor<int,4>::getSpareCount(&alloc) ), 0);
+    alloc.deallocate(first, 1);
+
+    alloc.prime();
+    ASSERT_EQ((TestAllocatorAccessor<int,4>::getSpareCount(&alloc) ), 2);
+
+    std::vector<int*> ptrs;
+    for(int i = 0; i < 8; ++i)
+        ptrs.push_back(alloc.allocate(1) );
+
+    //Фоновый поток восполняет запас после расширений
+    for(int i = 0; i < 1000 && TestAllocatorAccessor<int,4>::getSpareCount(&alloc) < 2; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1) );
+    ASSERT_EQ((TestAllocatorAccessor<int,4>::getSpareCount(&alloc) ), 2);
+
+    for(int i = 8; i < 20; ++i)
+        ASSERT_NO_THROW(ptrs.push_back(alloc.allocate(1) ) );
+    for(int i = 0; i < 20; ++i)
+        alloc.construct(ptrs[i], i);
+    for(int i = 0; i < 20; ++i)
+        ASSERT_EQ(*ptrs[i], i);
+    for(int i = 0; i < 20; ++i)
+        alloc.deallocate(ptrs[i], 1);
+}
+
+TEST(ALLOCATOR_TEST, map_reserve_test)
+{
+    //Копия аллокатора внутри std::map не подготовлена, расширения выполняются синхронно
+    std::map<int, int, std::less<int>, allocator::Allocator<std::pair<const int, int>, 3, true, 1>> values;
+    for(int i = 0; i < 100; ++i)
+        ASSERT_NO_THROW(values.emplace(i,i) );
+    ASSERT_EQ(values.size(), 100);
+    for(int i = 0; i < 100; ++i)
+        ASSERT_EQ(values[i], i);
+}
+
+TEST(ALLOCATOR_TEST, slot_map_size_test)
+{
+    ASSERT_EQ(sizeof(allocator::detail::SlotMap<3>), 1);
+    ASSERT_EQ(sizeof(allocator::detail::SlotMap<16>), 2);
+    ASSERT_EQ(sizeof(allocator::detail::SlotMap<64>), 8);
+}
+
+TEST(ALLOCATOR_TEST, slot_map_runs_test)
+{
+    allocator::detail::SlotMap<200> states;
+    ASSERT_EQ(states.findFree(201), 200);
+    ASSERT_EQ(states.findFree(200), 0);
+
+    states.set(0, 60);
+    ASSERT_EQ(states.findFree(1), 60);
+    //Серия пересекает границу слова
+    ASSERT_EQ(states.findFree(10), 60);
+    states.set(60, 10);
+    ASSERT_EQ(states.findFree(1), 70);
+    ASSERT_EQ(states.count(), 70);
+
+    states.set(70, 130);
+    ASSERT_TRUE(states.full() );
+    ASSERT_EQ(states.findFree(1), 200);
+
+    states.reset(100, 90);
+    ASSERT_EQ(states.findFree(90), 100);
+    ASSERT_EQ(states.findFree(91), 200);
+    ASSERT_EQ(states.findFree(1), 100);
+    ASSERT_EQ(states.count(), 110);
+}
+
+TEST(ALLOCATOR_TEST, large_pool_test)
+{
+    const std::size_t size = 5000;
+    allocator::Allocator<int, size> alloc;
+
+    std::vector<int*> ptrs;
+    for(std::size_t i = 0; i < size; ++i)
+    {
+        ptrs.push_back(alloc.allocate(1) );
+        ASSERT_EQ(ptrs.back(), ptrs.front() + i);
+    }
+    ASSERT_THROW(alloc.allocate(1), std::bad_alloc);
+
+    alloc.deallocate(ptrs[4000], 1);
+    alloc.deallocate(ptrs[130], 1);
+    ASSERT_EQ(alloc.allocate(1), ptrs[130]);
+    ASSERT_EQ(alloc.allocate(1), ptrs[4000]);
+
+    alloc.deallocate(ptrs[100], 200);
+    ASSERT_THROW(alloc.allocate(201), std::bad_alloc);
+    ASSERT_EQ(alloc.allocate(150), ptrs[100]);
+    ASSERT_EQ(alloc.allocate(50), ptrs[250]);
+}
+
+TEST(ALLOCATOR_TEST, best_fit_test)
+{
+    allocator::Allocator<int, 10, false, 0, true> alloc;
+
+    int* mem1 = alloc.allocate(4);
+    int* mem2 = alloc.allocate(2);
+    int* mem3 = alloc.allocate(2);
+    int* mem4 = alloc.allocate(2);
+    ASSERT_THROW(alloc.allocate(1), std::bad_alloc);
+
+    //Свободны серии длиной 4 и 2
+    alloc.deallocate(mem1, 4);
+    alloc.deallocate(mem3, 2);
+
+    //Запрос размещается в наименьшей подходящей серии, большая серия сохраняется
+    ASSERT_EQ(alloc.allocate(2), mem3);
+    ASSERT_EQ(alloc.allocate(4), mem1);
+    ASSERT_THROW(alloc.allocate(1), std::bad_alloc);
+
+    //Соседние освобожденные серии сливаются
+    alloc.deallocate(mem2, 2);
+    alloc.deallocate(mem1, 4);
+    alloc.deallocate(mem4, 2);
+    ASSERT_EQ(alloc.allocate(6), mem1);
+    ASSERT_THROW(alloc.allocate(3), std::bad_alloc);
+}
+
+TEST(ALLOCATOR_TEST, best_fit_expand_test)
+{
+    allocator::Allocator<int, 8, true, 0, true> alloc;
+
+    int* mem1 = alloc.allocate(8);
+    int* mem2 = alloc.allocate(8);
+
+    //Серия из 5 ячеек в первом блоке и из 2 ячеек во втором
+    alloc.deallocate(mem1, 5);
+    alloc.deallocate(mem2 + 3, 2);
+
+    //Наименьшая подходящая серия выбирается среди всех блоков
+    ASSERT_EQ(alloc.allocate(2), mem2 + 3);
+    ASSERT_EQ(alloc.allocate(5), mem1);
+
+    int* mem3 = alloc.allocate(1);
+    ASSERT_TRUE(mem3 < mem1 || mem3 >= mem1 + 8);
+    ASSERT_TRUE(mem3 < mem2 || mem3 >= mem2 + 8);
+}
+
+TEST(ALLOCATOR_TEST, best_fit_shared_class_test)
+{
+    //Серии длиной 8 и 9 относятся к одному классу, первой в классе оказывается более короткая
+    allocator::Allocator<int, 20, false, 0, true> alloc;
+    int* mem1 = alloc.allocate(9);
+    alloc.allocate(1);
+    int* mem3 = alloc.allocate(8);
+    alloc.allocate(2);
+    alloc.deallocate(mem1, 9);
+    alloc.deallocate(mem3, 8);
+    ASSERT_EQ(alloc.allocate(9), mem1);
+    ASSERT_EQ(alloc.allocate(8), mem3);
+
+    allocator::Allocator<int, 20, true, 0, true> expanding;
+    mem1 = expanding.allocate(9);
+    expanding.allocate(1);
+    mem3 = expanding.allocate(8);
+    expanding.allocate(2);
+    expanding.deallocate(mem1, 9);
+    expanding.deallocate(mem3, 8);
+    ASSERT_EQ(expanding.allocate(9), mem1);
+    ASSERT_EQ(expanding.chunkCount(), 1);
+}
+
+TEST(ALLOCATOR_TEST, best_fit_random_test)
+{
+    allocator::Allocator<int, 100, true, 0, true> alloc;
+    static_assert(noexcept(alloc.deallocate(nullptr, 0) ), "deallocate must not throw");
+
+    std::mt19937 rng(1);
+    std::map<int*, std::size_t> live;
+    for(int i = 0; i < 20000; ++i)
+    {
+        if(live.empty() || rng() % 2)
+        {
+            std::size_t n = 1 + rng() % (rng() % 5 ? 4 : 100);
+            int* ptr = alloc.allocate(n);
+            //Новый блок не пересекается с занятыми
+            auto next = live.lower_bound(ptr);
+            if(next != live.end() )
+            {
+                ASSERT_LE(ptr + n, next->first);
+            }
+            if(next != live.begin() )
+            {
+                ASSERT_LE(std::prev(next)->first + std::prev(next)->second, ptr);
+            }
+            live.emplace(ptr, n);
+        }
+        else
+        {
+            auto itr = live.begin();
+            std::advance(itr, rng() % live.size() );
+            alloc.deallocate(itr->first, itr->second);
+            live.erase(itr);
+        }
+    }
+    for(const auto& item : live)
+        alloc.deallocate(item.first, item.second);
+    //После освобождения всех ячеек серии каждого блока слиты в одну
+    std::size_t chunks = alloc.chunkCount();
+    for(std::size_t i = 0; i < chunks; ++i)
+        alloc.allocate(100);
+    ASSERT_EQ(alloc.chunkCount(), chunks);
+}
+
+TEST(ALLOCATOR_TEST, compact_test)
+{
+    allocator::Allocator<TestValueType, 4, true> alloc;
+
+    std::map<TestValueType*, int> live;
+    for(int i = 0; i < 16; ++i)
+    {
+        TestValueType* ptr = alloc.allocate(1);
+        alloc.construct(ptr, i, std::to_string(i) );
+        live[ptr] = i;
+    }
+    ASSERT_EQ(alloc.chunkCount(), 4);
+
+    //В каждом блоке остается по одному объекту
+    for(auto itr = live.begin(); itr != live.end(); )
+    {
+        if(itr->second % 4)
+        {
+            alloc.destroy(itr->first);
+            alloc.deallocate(itr->first, 1);
+            itr = live.erase(itr);
+        }
+        else
+            ++itr;
+    }
+
+    std::map<TestValueType*, TestValueType*> moved;
+    ASSERT_EQ(alloc.compact([&moved](TestValueType* from, TestValueType* to){moved[from] = to;}), 3);
+    ASSERT_EQ(alloc.chunkCount(), 1);
+    ASSERT_EQ(moved.size(), 3);
+
+    std::set<int> values;
+    for(const auto& item : live)
+    {
+        auto itr = moved.find(item.first);
+        TestValueType* ptr = itr == moved.end() ? item.first : itr->second;
+        ASSERT_EQ(*ptr, TestValueType(item.second, std::to_string(item.second) ) );
+        values.insert(ptr->number() );
+    }
+    ASSERT_EQ(values.size(), 4);
+
+    std::size_t count = 0;
+    alloc.forEachAllocated([&alloc, &count](TestValueType* ptr){alloc.destroy(ptr); ++count;});
+    ASSERT_EQ(count, 4);
+}
+
+TEST(ALLOCATOR_TEST, upstream_test)
+{
+    allocator::Allocator<int, 4, false, 0, false, std::allocator<int>> alloc;
+    ASSERT_EQ(alloc.max_size(), std::allocator_traits<std::allocator<int>>::max_size(std::allocator<int>() ) );
+
+    std::vector<int*> pooled;
+    for(int i = 0; i < 4; ++i)
+        pooled.push_back(alloc.allocate(1) );
+    for(int i = 1; i < 4; ++i)
+        ASSERT_EQ(pooled[i], pooled[0] + i);
+
+    //Массивы и запросы к заполненному пулу обслуживает внешний аллокатор
+    int* array = nullptr;
+    ASSERT_NO_THROW(array = alloc.allocate(2) );
+    ASSERT_TRUE(array + 2 <= pooled[0] || array >= pooled[0] + 4);
+    int* overflow = nullptr;
+    ASSERT_NO_THROW(overflow = alloc.allocate(1) );
+    ASSERT_TRUE(overflow < pooled[0] || overflow >= pooled[0] + 4);
+    array[1] = 1;
+    *overflow = 2;
+
+    alloc.deallocate(overflow, 1);
+    alloc.deallocate(array, 2);
+    alloc.deallocate(pooled[2], 1);
+    ASSERT_EQ(alloc.allocate(1), pooled[2]);
+}
+
+TEST(ALLOCATOR_TEST, vector_upstream_test)
+{
+    std::vector<int, allocator::Allocator<int, 7, false, 0, false, std::allocator<int>>> values;
+    for(int i = 0; i < 1000; ++i)
+        ASSERT_NO_THROW(values.push_back(i) );
+    for(int i = 0; i < 1000; ++i)
+        ASSERT_EQ(values[i], i);
+}
+
+TEST(ALLOCATOR_TEST, unordered_map_upstream_test)
+{
+    std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+        allocator::Allocator<std::pair<const int, int>, 16, true, 0, false, std::allocator<int>>> values;
+    for(int i = 0; i < 1000; ++i)
+        ASSERT_NO_THROW(values.emplace(i, i) );
+    for(int i = 0; i < 1000; ++i)
+        ASSERT_EQ(values.at(i), i);
+}
+
+TEST(ALLOCATOR_TEST, index_test)
+{
+    allocator::Allocator<int, 4, true, 0, false, void, true> alloc;
+    ASSERT_EQ(alloc.toIndex(nullptr), 0u);
+    ASSERT_EQ(alloc.fromIndex(0), nullptr);
+
+    std::vector<int*> ptrs;
+    std::set<std::uint32_t> indices;
+    for(int i = 0; i < 12; ++i)
+    {
+        ptrs.push_back(alloc.allocate(1) );
+        std::uint32_t index = alloc.toIndex(ptrs.back() );
+        ASSERT_NE(index, 0u);
+        ASSERT_EQ(alloc.fromIndex(index), ptrs.back() );
+        indices.insert(index);
+    }
+    ASSERT_EQ(indices.size(), 12);
+    ASSERT_EQ(*indices.rbegin(), 12u);
+
+    //Номер освобожденного блока используется повторно
+    for(int i = 4; i < 8; ++i)
+        alloc.deallocate(ptrs[i], 1);
+    ASSERT_EQ(alloc.compact([](int*, int*){}), 1);
+    int* ptr = alloc.allocate(1);
+    ASSERT_LE(alloc.toIndex(ptr), 12u);
+    ASSERT_EQ(alloc.fromIndex(alloc.toIndex(ptr) ), ptr);
+
+    std::uint32_t index = 0;
+    ptr = alloc.allocateIndexed(index);
+    ASSERT_EQ(alloc.toIndex(ptr), index);
+    ASSERT_EQ(alloc.fromIndex(index), ptr);
+}
+
+TEST(ALLOCATOR_TEST, equality_test)
+{
+    allocator::Allocator<int, 4> alloc;
+    allocator::Allocator<int, 4> copy(alloc);
+    ASSERT_TRUE(alloc == alloc);
+    ASSERT_TRUE(alloc != copy);
+}
+
+TEST(ALLOCATOR_TEST, vector_upstream_swap_test)
+{
+    using Alloc = allocator::Allocator<int, 4, true, 0, false, std::allocator<int>>;
+    std::vector<int, Alloc> lhs;
+    std::vector<int, Alloc> rhs;
+    lhs.push_back(1);
+    rhs.push_back(2);
+
+    //Буферы из пулов обмениваются вместе с пулами
+    lhs.swap(rhs);
+    ASSERT_EQ(lhs.front(), 2);
+    ASSERT_EQ(rhs.front(), 1);
+
+    lhs = std::move(rhs);
+    ASSERT_EQ(lhs.size(), 1);
+    ASSERT_EQ(lhs.front(), 1);
+    lhs.push_back(3);
+    ASSERT_EQ(lhs.back(), 3);
+
+    std::vector<int, Alloc> moved(std::move(lhs) );
+    ASSERT_EQ(moved.size(), 2);
+    ASSERT_EQ(moved.front(), 1);
+}
+
+TEST(ALLOCATOR_TEST, list_upstream_swap_test)
+{
+    using Alloc = allocator::Allocator<int, 2, false, 0, false, std::allocator<int>>;
+    std::list<int, Alloc> lhs;
+    std::list<int, Alloc> rhs;
+    //Узлы сверх емкости пула размещаются внешним аллокатором
+    for(int i = 0; i < 5; ++i)
+    {
+        lhs.push_back(i);
+        rhs.push_back(10 + i);
+    }
+    lhs.swap(rhs);
+    ASSERT_EQ(lhs.front(), 10);
+    ASSERT_EQ(rhs.back(), 4);
+    rhs = std::move(lhs);
+    ASSERT_EQ(rhs.size(), 5);
+    ASSERT_EQ(rhs.front(), 10);
+}
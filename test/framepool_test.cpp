@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+#include "framepool.h"
+#include <memory>
+#include <functional>
+#include <vector>
+#include <thread>
+
+namespace
+{
+
+class Callback: public allocator::PoolAllocated<allocator::FramePool<256, 32, 4>>
+{
+public:
+    virtual ~Callback() = default;
+    virtual int call(int v) = 0;
+};
+
+template<class F>
+class CallbackImpl: public Callback
+{
+public:
+    explicit CallbackImpl(F f): m_f(std::move(f) ) {}
+    int call(int v) override {return m_f(v);}
+
+private:
+    F m_f;
+};
+
+template<class F>
+std::unique_ptr<Callback> makeCallback(F f)
+{
+    return std::unique_ptr<Callback>(new CallbackImpl<F>(std::move(f) ) );
+}
+
+}
+
+TEST(FRAMEPOOL_TEST, size_classes_test)
+{
+    allocator::FramePool<256, 32, 4> pool;
+
+    void* small1 = pool.allocate(1);
+    void* small2 = pool.allocate(32);
+    ASSERT_EQ(static_cast<char*>(small2) - static_cast<char*>(small1), 32);
+
+    void* medium = pool.allocate(33);
+    void* large = pool.allocate(257);
+    static_cast<char*>(large)[256] = 1;
+
+    pool.deallocate(small1, 1);
+    ASSERT_EQ(pool.allocate(20), small1);
+    pool.deallocate(medium, 33);
+    ASSERT_EQ(pool.allocate(64), medium);
+
+    pool.deallocate(large, 257);
+    pool.deallocate(small1, 20);
+    pool.deallocate(small2, 32);
+    pool.deallocate(medium, 64);
+}
+
+TEST(FRAMEPOOL_TEST, callback_test)
+{
+    std::vector<std::unique_ptr<Callback>> callbacks;
+    for(int i = 0; i < 100; ++i)
+        callbacks.push_back(makeCallback([i](int v){return v + i;}) );
+
+    long long big[40] = {};
+    big[39] = 7;
+    callbacks.push_back(makeCallback([big](int v){return v + static_cast<int>(big[39]);}) );
+
+    for(int i = 0; i < 100; ++i)
+        ASSERT_EQ(callbacks[i]->call(1), i + 1);
+    ASSERT_EQ(callbacks.back()->call(1), 8);
+}
+
+TEST(FRAMEPOOL_TEST, foreign_free_test)
+{
+    allocator::FramePool<256, 32, 4> owner;
+    void* ptr = owner.allocate(40);
+    {
+        //Блок, освобожденный через другой пул, возвращается владельцу
+        allocator::FramePool<256, 32, 4> other;
+        other.deallocate(ptr, 40);
+    }
+    //Блок снова выдается владельцем, когда текущий участок исчерпан
+    std::vector<void*> ptrs;
+    while(ptrs.size() < 100 && (ptrs.empty() || ptrs.back() != ptr) )
+        ptrs.push_back(owner.allocate(40) );
+    ASSERT_EQ(ptrs.back(), ptr);
+    for(void* p : ptrs)
+        owner.deallocate(p, 40);
+}
+
+TEST(FRAMEPOOL_TEST, thread_exit_test)
+{
+    //Объекты переживают поток, в котором размещены, и освобождаются в другом потоке
+    std::vector<std::unique_ptr<Callback>> callbacks;
+    std::thread producer([&callbacks]()
+    {
+        for(int i = 0; i < 100; ++i)
+            callbacks.push_back(makeCallback([i](int v){return v * i;}) );
+    });
+    producer.join();
+
+    for(int i = 0; i < 100; ++i)
+        ASSERT_EQ(callbacks[i]->call(2), 2 * i);
+    callbacks.clear();
+    for(int i = 0; i < 100; ++i)
+        callbacks.push_back(makeCallback([i](int v){return v - i;}) );
+    ASSERT_EQ(callbacks[99]->call(100), 1);
+}
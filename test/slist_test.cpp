@@ -1,7 +1,12 @@
 #include <gtest/gtest.h>
 #include "slist.h"
 #include "allocator.h"
+#include "testallocatoraccessor.h"
 #include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
 
 TEST(SLIST_TEST, slist_custom_allocator_test)
 {
@@ -54,3 +59,173 @@ TEST(SLIST_TEST, slist_standard_allocator_test)
 
     ASSERT_NO_THROW(list.addItem(6) );
 }
+
+TEST(SLIST_TEST, slist_unordered_traversal_test)
+{
+    slist::SList<int, allocator::Allocator<int, 16, true>> list;
+    for(int i = 1; i <= 1000; ++i)
+        list.addItem(i);
+
+    long long sum = 0;
+    std::size_t count = 0;
+    list.unorderedForEach([&sum, &count](int& v){sum += v; ++count;});
+    ASSERT_EQ(count, 1000u);
+    ASSERT_EQ(sum, 500500);
+
+    ASSERT_EQ(list.unorderedReduce(0LL, [](long long acc, int v){return acc + v;}), 500500);
+
+    std::atomic<long long> atomicSum(0);
+    list.parallelForEach([&atomicSum](int& v){atomicSum += v; v *= 2;}, 4);
+    ASSERT_EQ(atomicSum.load(), 500500);
+
+    auto plus = [](long long lhs, long long rhs){return lhs + rhs;};
+    ASSERT_EQ(list.parallelReduce(0LL, plus, plus, 4), 1001000);
+    ASSERT_EQ(list.parallelReduce(0LL, plus, plus, 100), 1001000);
+}
+
+TEST(SLIST_TEST, slist_standard_allocator_traversal_test)
+{
+    slist::SList<int> list;
+    ASSERT_EQ(list.unorderedReduce(0, [](int acc, int v){return acc + v;}), 0);
+    for(int i = 1; i <= 100; ++i)
+        list.addItem(i);
+
+    auto plus = [](int lhs, int rhs){return lhs + rhs;};
+    ASSERT_EQ(list.unorderedReduce(0, plus), 5050);
+    ASSERT_EQ(list.parallelReduce(0, plus, plus, 3), 5050);
+
+    std::atomic<int> count(0);
+    list.parallelForEach([&count](int&){++count;});
+    ASSERT_EQ(count.load(), 100);
+}
+
+TEST(SLIST_TEST, slist_compact_test)
+{
+    slist::SList<int, allocator::Allocator<int, 8, true>> list;
+    for(int i = 0; i < 64; ++i)
+        list.addItem(i);
+
+    ASSERT_EQ(list.removeIf([](int v){return v % 4 != 0;}), 48u);
+    ASSERT_EQ(list.compact(), 6u);
+
+    int expected = 0;
+    for(auto v : list)
+    {
+        ASSERT_EQ(v, expected);
+        expected += 4;
+    }
+    ASSERT_EQ(expected, 64);
+
+    list.addItem(64);
+    ASSERT_EQ(list.unorderedReduce(0, [](int acc, int v){return acc + v;}), 544);
+
+    ASSERT_EQ(list.removeIf([](int){return true;}), 17u);
+    ASSERT_TRUE(list.isEmpty() );
+    ASSERT_EQ(list.compact(), 3u);
+}
+
+namespace
+{
+
+//Значение, перемещение которого бросает исключение после заданного числа перемещений
+struct FragileValue
+{
+    FragileValue(int v): value(v) {}
+    FragileValue(const FragileValue&) = default;
+    FragileValue(FragileValue&& rhs):
+        value(rhs.value)
+    {
+        if(movesLeft-- == 0)
+            throw std::runtime_error("move failed");
+    }
+
+    static int movesLeft;
+    int value;
+};
+
+int FragileValue::movesLeft = 0;
+
+}
+
+TEST(SLIST_TEST, slist_compact_throw_test)
+{
+    slist::SList<FragileValue, allocator::Allocator<FragileValue, 8, true>> list;
+    for(int i = 0; i < 64; ++i)
+        list.addItem(i);
+    ASSERT_EQ(list.removeIf([](const FragileValue& v){return v.value % 4 != 0;}), 48u);
+
+    //Перенос прерывается исключением, уже перенесенные узлы перепривязаны
+    FragileValue::movesLeft = 3;
+    ASSERT_THROW(list.compact(), std::runtime_error);
+    for(int i = 64; i < 96; i += 4)
+        list.addItem(i);
+    int expected = 0;
+    for(const auto& v : list)
+    {
+        ASSERT_EQ(v.value, expected);
+        expected += 4;
+    }
+    ASSERT_EQ(expected, 96);
+
+    FragileValue::movesLeft = 1000;
+    list.compact();
+    expected = 0;
+    for(const auto& v : list)
+    {
+        ASSERT_EQ(v.value, expected);
+        expected += 4;
+    }
+    ASSERT_EQ(expected, 96);
+}
+
+TEST(SLIST_TEST, slist_reserve_test)
+{
+    using Accessor = TestAllocatorAccessor<slist::Node<int>, 4>;
+    slist::SList<int, allocator::Allocator<int, 4, true, 2>> list;
+    ASSERT_EQ(Accessor::getSpareCount(&list.getAllocator() ), 0u);
+
+    list.prime();
+    ASSERT_EQ(Accessor::getSpareCount(&list.getAllocator() ), 2u);
+
+    for(int i = 0; i < 12; ++i)
+        list.addItem(i);
+    //Фоновый поток восполняет запас после расширений
+    for(int i = 0; i < 1000 && Accessor::getSpareCount(&list.getAllocator() ) < 2; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1) );
+    ASSERT_EQ(Accessor::getSpareCount(&list.getAllocator() ), 2u);
+
+    int expected = 0;
+    for(auto v : list)
+        ASSERT_EQ(v, expected++);
+    ASSERT_EQ(expected, 12);
+}
+
+TEST(SLIST_TEST, index_slist_test)
+{
+    ASSERT_EQ(sizeof(slist::IndexNode<int>), 2 * sizeof(int) );
+
+    slist::IndexSList<int, allocator::Allocator<int, 5, true>> list;
+    ASSERT_TRUE(list.isEmpty() );
+    ASSERT_TRUE(list.begin() == list.end() );
+    for(int i = 0; i < 100; ++i)
+        ASSERT_NO_THROW(list.addItem(i) );
+    ASSERT_FALSE(list.isEmpty() );
+
+    int expected = 0;
+    for(auto v : list)
+        ASSERT_EQ(v, expected++);
+    ASSERT_EQ(expected, 100);
+
+    slist::IndexSList<int, allocator::Allocator<int, 5, true>> copy(list);
+    slist::IndexSList<int, allocator::Allocator<int, 5, true>> moved(std::move(list) );
+    ASSERT_TRUE(list.isEmpty() );
+
+    auto itr = moved.begin();
+    for(const auto& v : copy)
+        ASSERT_EQ(v, *itr++);
+    ASSERT_TRUE(itr == moved.end() );
+
+    int sum = 0;
+    moved.unorderedForEach([&sum](int v){sum += v;});
+    ASSERT_EQ(sum, 4950);
+}
@@ -4,10 +4,11 @@
 #include <vector>
 #include <array>
 #include <cassert>
+#include <mutex>
 
 namespace allocator
 {
-template<class T, std::size_t N, bool Expand>
+template<class T, std::size_t N, bool Expand, std::size_t Reserve, bool BestFit, class Upstream, bool Indexed>
 class Allocator;
 }
 
@@ -18,16 +19,15 @@ public:
     static std::array<char, N> getMemoryMap(allocator::Allocator<T,N>* alloc)
     {
         std::array<char, N> result;
-        char* memStart = static_cast<char*>(alloc->m_head->states);
-        for(int i = 0; i < N; ++i)
-            result[i] = *(memStart+i);
+        for(std::size_t i = 0; i < N; ++i)
+            result[i] = alloc->m_head->states.test(i) ? allocator::ALLOCATE_STATE : allocator::DEALLOCATE_STATE;
         return result;
     }
 
     static const T& getValue(allocator::Allocator<T,N>* alloc, size_t pos)
     {
         assert(pos >=0 && pos < N);
-        if(static_cast<char*>(alloc->m_head->states)[pos] == allocator::DEALLOCATE_STATE)
+        if(!alloc->m_head->states.test(pos) )
             throw std::invalid_argument("");
         return *(reinterpret_cast<T*>(alloc->m_head->memory) + pos);
     }
@@ -36,6 +36,15 @@ public:
     {
         return alloc->m_head == nullptr;
     }
+
+    template<std::size_t Reserve, bool BestFit, class Upstream, bool Indexed>
+    static std::size_t getSpareCount(const allocator::Allocator<T,N,true,Reserve,BestFit,Upstream,Indexed>* alloc)
+    {
+        if(!alloc->m_reserve)
+            return 0;
+        std::lock_guard<std::mutex> lock(alloc->m_reserve->mutex);
+        return alloc->m_reserve->count;
+    }
 };
 
 #endif